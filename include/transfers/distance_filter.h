@@ -0,0 +1,66 @@
+#pragma once
+
+#include <cinttypes>
+#include <string>
+#include <vector>
+
+#include "geo/latlng.h"
+
+namespace transfers {
+
+enum class distance_check : std::uint8_t { kOutside, kInside, kExact };
+
+// Classifies n candidates against the circle (pos, radius) in one batch.
+// A vectorized haversine approximation (AVX2 / NEON, scalar otherwise)
+// decides everything that is clearly inside or outside. Candidates close to
+// the boundary (or too far away for the approximation) are marked kExact and
+// have to be checked with geo::distance.
+// use_simd = false forces the scalar implementation.
+void classify_distances(geo::latlng const& pos,
+                        double radius,
+                        double const* lat,
+                        double const* lng,
+                        std::size_t n,
+                        distance_check* out,
+                        bool use_simd = true);
+
+// AVX2 (checked at runtime) or NEON available.
+bool has_simd_distance_filter();
+
+// Collects candidates and keeps those with geo::distance(pos, x) <= radius.
+template <typename T>
+struct distance_filter {
+  void clear() {
+    lat_.clear();
+    lng_.clear();
+    items_.clear();
+  }
+
+  void add(T const item, geo::latlng const& x) {
+    lat_.push_back(x.lat_);
+    lng_.push_back(x.lng_);
+    items_.push_back(item);
+  }
+
+  void filter(geo::latlng const& pos,
+              double const radius,
+              std::basic_string<T>& results) {
+    results.clear();
+    checks_.resize(items_.size());
+    classify_distances(pos, radius, lat_.data(), lng_.data(), items_.size(),
+                       checks_.data());
+    for (auto i = 0U; i != items_.size(); ++i) {
+      if (checks_[i] == distance_check::kInside ||
+          (checks_[i] == distance_check::kExact &&
+           !(geo::distance(pos, {lat_[i], lng_[i]}) > radius))) {
+        results.push_back(items_[i]);
+      }
+    }
+  }
+
+  std::vector<double> lat_, lng_;
+  std::vector<T> items_;
+  std::vector<distance_check> checks_;
+};
+
+}  // namespace transfers
\ No newline at end of file
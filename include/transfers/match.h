@@ -1,13 +1,66 @@
 #pragma once
 
-namespace nigiri {
-struct timetable;
-}
+#include <filesystem>
+#include <iosfwd>
+
+#include "cista/hash.h"
+#include "cista/memory_holder.h"
+
+#include "nigiri/types.h"
+
+#include "transfers/matches.h"
+#include "transfers/types.h"
 
 namespace transfers {
 
-struct database;
+// matches::fits() and platform indices refer to this database.
+bool fits(matches const&, nigiri::timetable const&, database const&);
+
+cista::hash_t platforms_hash(database const&);
+
+// State for rematch(), stored next to the matches. Consumers of the matches
+// don't need it.
+struct rematch_state {
+  static constexpr auto const kVersion = std::uint32_t{1U};
+
+  void write(std::filesystem::path const&) const;
+  static cista::wrapped<rematch_state> read(cista::memory_holder&&);
+
+  std::uint32_t version_{kVersion};
+
+  // Location id, hash(id, name, coordinates), hash of matched platform
+  vecvec<nigiri::location_idx_t, char> ids_;
+  vector_map<nigiri::location_idx_t, cista::hash_t> fingerprints_;
+  vector_map<nigiri::location_idx_t, cista::hash_t> platform_fingerprints_;
+
+  // Sorted fingerprints of all platforms in the database
+  vector<cista::hash_t> platforms_;
+};
+
+struct match_result {
+  matches matches_;
+  rematch_state state_;
+
+  // Number of locations matched from scratch, the rest was reused by
+  // rematch(). All locations for match().
+  std::uint32_t n_matched_{0U};
+};
+
+match_result match(nigiri::timetable const&, database const&);
+
+// Same result as match() but reuses matches from a previous timetable /
+// platform database version. Only locations whose id, name or coordinates
+// changed, whose matched platform changed, or that are near a new platform
+// are matched again.
+match_result rematch(nigiri::timetable const&,
+                     database const&,
+                     matches const& prev,
+                     rematch_state const& prev_state);
 
-void match(nigiri::timetable const&, database&);
+// Debug output: platforms, locations and matches as GeoJSON.
+void write_geojson(std::ostream&,
+                   nigiri::timetable const&,
+                   database const&,
+                   matches const&);
 
 }  // namespace transfers
\ No newline at end of file
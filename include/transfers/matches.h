@@ -0,0 +1,65 @@
+#pragma once
+
+#include <cinttypes>
+#include <filesystem>
+
+#include "cista/containers/vector.h"
+#include "cista/hash.h"
+#include "cista/memory_holder.h"
+#include "cista/strong.h"
+
+#include "nigiri/types.h"
+
+namespace nigiri {
+struct timetable;
+}
+
+// Binary match artifact. Only depends on cista and nigiri so consumers
+// (e.g. nigiri) can read it without pulling in osmium / ppr.
+namespace transfers {
+
+// Same type as in transfers/types.h
+using platform_idx_t = cista::strong<std::uint32_t, struct platform_idx_>;
+
+struct location_match {
+  platform_idx_t platform_{platform_idx_t::invalid()};
+  float score_{0.0F};  // distance - bonus, lower is better
+  float distance_{0.0F};  // meters
+  std::int64_t osm_id_{0};
+  std::uint8_t osm_type_{0U};  // ppr::routing::osm_namespace (0 = node)
+};
+
+// Readers can mmap it and access it without parsing.
+struct matches {
+  static constexpr auto const kVersion = std::uint32_t{1U};
+
+  // Checks that this was computed for the same locations (ids, names,
+  // coordinates) as `tt`.
+  bool fits(nigiri::timetable const&) const;
+
+  void write(std::filesystem::path const&) const;
+  static cista::wrapped<matches> read(cista::memory_holder&&);
+
+  std::uint32_t version_{kVersion};
+  std::uint32_t n_locations_{0U};
+  cista::hash_t locations_hash_{cista::BASE_HASH};
+
+  // Hash over all platforms in index order (= version of the platform
+  // database). platform_idx_t values are only valid for this database.
+  cista::hash_t platforms_hash_{cista::BASE_HASH};
+
+  // Timetable location -> best platform (invalid platform if none found)
+  cista::offset::vector_map<nigiri::location_idx_t, location_match> locations_;
+};
+
+// hash(id, name, coordinates)
+cista::hash_t location_fingerprint(nigiri::timetable const&,
+                                   nigiri::location_idx_t);
+
+// Hash over location_fingerprint() of all locations in index order.
+cista::hash_t locations_hash(
+    cista::offset::vector_map<nigiri::location_idx_t, cista::hash_t> const&);
+
+cista::hash_t locations_hash(nigiri::timetable const&);
+
+}  // namespace transfers
\ No newline at end of file
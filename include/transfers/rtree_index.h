@@ -1,7 +1,7 @@
 #pragma once
 
 #include <array>
-#include <tuple>
+#include <string>
 
 #include "geo/box.h"
 #include "geo/latlng.h"
@@ -10,6 +10,8 @@
 
 #include "rtree.h"
 
+#include "transfers/distance_filter.h"
+
 namespace transfers {
 
 template <typename T>
@@ -26,38 +28,31 @@ struct rtree_index {
                  reinterpret_cast<void*>(to_idx(idx)));
   }
 
+  // `candidates` is scratch space owned by the caller (like `results`).
   void search(geo::latlng const& pos,
               double radius,
-              std::basic_string<T>& results) const {
-    using udata_t = std::tuple<geo::latlng const* /* search position */,
-                               double /* search radius */,
-                               std::basic_string<T>* /* results storage */>;
+              std::basic_string<T>& results,
+              distance_filter<T>& candidates) const {
+    using udata_t = distance_filter<T>;
 
-    results.clear();
+    candidates.clear();
 
     auto const b = geo::box{pos, radius};
     auto const min = std::array<double, 2U>{b.min_.lng_, b.min_.lat_};
     auto const max = std::array<double, 2U>{b.max_.lng_, b.max_.lat_};
-    auto udata = udata_t{&pos, radius, &results};
     rtree_search(
         rtree_, min.data(), max.data(),
         [](double const* min_entry, double const* /* max */, void const* item,
            void* udata_ptr) {
-          auto const [p, r, rtree_results_ptr] =
-              *reinterpret_cast<udata_t const*>(udata_ptr);
-
-          if (geo::distance(*p, {min_entry[1], min_entry[0]}) > r) {
-            return true;
-          }
-
           auto const x = T{static_cast<typename T::value_t>(
               reinterpret_cast<std::intptr_t>(item))};
-
-          rtree_results_ptr->push_back(x);
-
+          reinterpret_cast<udata_t*>(udata_ptr)->add(
+              x, {min_entry[1], min_entry[0]});
           return true;
         },
-        &udata);
+        &candidates);
+
+    candidates.filter(pos, radius, results);
   }
 
   rtree* rtree_;
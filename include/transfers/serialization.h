@@ -0,0 +1,45 @@
+#pragma once
+
+#include <filesystem>
+#include <type_traits>
+#include <variant>
+
+#include "cista/memory_holder.h"
+#include "cista/mmap.h"
+#include "cista/serialization.h"
+
+#include "utl/verify.h"
+
+namespace transfers {
+
+constexpr auto const kMode =
+    cista::mode::WITH_INTEGRITY | cista::mode::WITH_STATIC_VERSION;
+
+template <typename T>
+void write(std::filesystem::path const& p, T const& x) {
+  auto mmap = cista::mmap{p.generic_string().c_str(),
+                          cista::mmap::protection::WRITE};
+  auto writer = cista::buf<cista::mmap>(std::move(mmap));
+  cista::serialize<kMode>(writer, x);
+}
+
+// Memory mapped files are accessed in place (no deserialization).
+template <typename T>
+cista::wrapped<T> read(cista::memory_holder&& mem) {
+  auto const ptr = std::visit(
+      [](auto& b) -> T* {
+        if constexpr (std::is_same_v<std::decay_t<decltype(b)>,
+                                     cista::buf<cista::mmap>>) {
+          return reinterpret_cast<T*>(&b[cista::data_start(kMode)]);
+        } else {
+          return cista::deserialize<T, kMode>(b);
+        }
+      },
+      mem);
+  utl::verify(ptr->version_ == T::kVersion,
+              "version mismatch [file={}, expected={}]", ptr->version_,
+              T::kVersion);
+  return cista::wrapped{std::move(mem), ptr};
+}
+
+}  // namespace transfers
\ No newline at end of file
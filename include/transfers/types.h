@@ -30,6 +30,9 @@ inline geo::latlng to_geo(ppr::location const& l) noexcept {
 template <typename K, typename V>
 using hash_map = cista::offset::ankerl_map<K, V>;
 
+template <typename V>
+using vector = cista::offset::vector<V>;
+
 template <typename K, typename V>
 using vecvec = cista::offset::vecvec<K, V>;
 
@@ -0,0 +1,258 @@
+#include "transfers/distance_filter.h"
+
+#include <algorithm>
+#include <cmath>
+
+// AVX2 is compiled for every x86-64 build and selected at runtime.
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define TRANSFERS_AVX2_TARGET __attribute__((target("avx2")))
+#elif defined(_M_X64) && defined(__AVX2__)
+#define TRANSFERS_AVX2_TARGET
+#endif
+
+#if defined(TRANSFERS_AVX2_TARGET)
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+#include "geo/constants.h"
+
+namespace transfers {
+
+namespace {
+
+constexpr auto const kToRad = 3.14159265358979323846 / 180.0;
+
+// The polynomials below are truncated Taylor series. Within this angle
+// (~64km) their error is many orders of magnitude below kMargin.
+constexpr auto const kMaxAngle = 0.01;
+
+// Band around the threshold that is left to geo::distance: relative for
+// rounding in the approximation, absolute (in units of the half angle,
+// ~1 micrometer) for geo::distance converting to radians before subtracting.
+constexpr auto const kMargin = 1E-9;
+constexpr auto const kAbsMargin = 1E-13;
+
+// Haversine: a = sin²(Δlat/2) + cos(lat1)·cos(lat2)·sin²(Δlng/2)
+// with cos(lat2) = cos(lat1)·cos(Δlat) - sin(lat1)·sin(Δlat)
+// distance <= r  <=>  a <= sin²(r / 2R)
+struct params {
+  params(geo::latlng const& pos, double const radius)
+      : lat_{pos.lat_},
+        lng_{pos.lng_},
+        cos_lat_{std::cos(pos.lat_ * kToRad)},
+        sin_lat_{std::sin(pos.lat_ * kToRad)} {
+    auto const s = std::sin(radius / (2.0 * geo::kEarthRadiusMeters));
+    auto const s_lo = std::max(0.0, s - kAbsMargin);
+    auto const s_hi = s + kAbsMargin;
+    lo_ = s_lo * s_lo * (1.0 - kMargin);
+    hi_ = s_hi * s_hi * (1.0 + kMargin);
+  }
+
+  double lat_, lng_;
+  double cos_lat_, sin_lat_;
+  double lo_, hi_;
+};
+
+inline distance_check classify(params const& p,
+                               double const lat,
+                               double const lng) {
+  auto const dlat = (lat - p.lat_) * kToRad;
+  auto const dlng = (lng - p.lng_) * kToRad;
+  if (!(std::abs(dlat) <= kMaxAngle && std::abs(dlng) <= kMaxAngle)) {
+    return distance_check::kExact;
+  }
+
+  auto const dlat2 = dlat * dlat;
+  auto const dlng2 = dlng * dlng;
+  auto const cos_dlat = 1.0 - dlat2 * (1.0 / 2.0 - dlat2 * (1.0 / 24.0));
+  auto const sin_dlat =
+      dlat * (1.0 - dlat2 * (1.0 / 6.0 - dlat2 * (1.0 / 120.0)));
+  auto const hav_lat =
+      dlat2 * (1.0 / 4.0 - dlat2 * (1.0 / 48.0 - dlat2 * (1.0 / 1440.0)));
+  auto const hav_lng =
+      dlng2 * (1.0 / 4.0 - dlng2 * (1.0 / 48.0 - dlng2 * (1.0 / 1440.0)));
+  auto const cos_lat2 = p.cos_lat_ * cos_dlat - p.sin_lat_ * sin_dlat;
+  auto const a = hav_lat + p.cos_lat_ * cos_lat2 * hav_lng;
+
+  return a < p.lo_   ? distance_check::kInside
+         : a > p.hi_ ? distance_check::kOutside
+                     : distance_check::kExact;
+}
+
+#if defined(TRANSFERS_AVX2_TARGET)
+
+bool has_simd() {
+#if defined(__GNUC__) || defined(__clang__)
+  return __builtin_cpu_supports("avx2") != 0;
+#else
+  return true;
+#endif
+}
+
+TRANSFERS_AVX2_TARGET inline __m256d avx2_abs(__m256d const x) {
+  return _mm256_andnot_pd(_mm256_set1_pd(-0.0), x);
+}
+
+// c0 - x2 * (c1 - x2 * c2)
+TRANSFERS_AVX2_TARGET inline __m256d avx2_poly(__m256d const x2,
+                                               double const c0,
+                                               double const c1,
+                                               double const c2) {
+  return _mm256_sub_pd(
+      _mm256_set1_pd(c0),
+      _mm256_mul_pd(x2, _mm256_sub_pd(_mm256_set1_pd(c1),
+                                      _mm256_mul_pd(x2, _mm256_set1_pd(c2)))));
+}
+
+TRANSFERS_AVX2_TARGET std::size_t classify_batch(params const& p,
+                                                 double const* lat,
+                                                 double const* lng,
+                                                 std::size_t const n,
+                                                 distance_check* out) {
+  auto const to_rad = _mm256_set1_pd(kToRad);
+  auto const max_angle = _mm256_set1_pd(kMaxAngle);
+  auto const lat1 = _mm256_set1_pd(p.lat_);
+  auto const lng1 = _mm256_set1_pd(p.lng_);
+  auto const cos_lat1 = _mm256_set1_pd(p.cos_lat_);
+  auto const sin_lat1 = _mm256_set1_pd(p.sin_lat_);
+  auto const lo = _mm256_set1_pd(p.lo_);
+  auto const hi = _mm256_set1_pd(p.hi_);
+
+  auto i = std::size_t{0U};
+  for (; i + 4U <= n; i += 4U) {
+    auto const dlat =
+        _mm256_mul_pd(_mm256_sub_pd(_mm256_loadu_pd(lat + i), lat1), to_rad);
+    auto const dlng =
+        _mm256_mul_pd(_mm256_sub_pd(_mm256_loadu_pd(lng + i), lng1), to_rad);
+    auto const dlat2 = _mm256_mul_pd(dlat, dlat);
+    auto const dlng2 = _mm256_mul_pd(dlng, dlng);
+
+    auto const cos_dlat = avx2_poly(dlat2, 1.0, 1.0 / 2.0, 1.0 / 24.0);
+    auto const sin_dlat =
+        _mm256_mul_pd(dlat, avx2_poly(dlat2, 1.0, 1.0 / 6.0, 1.0 / 120.0));
+    auto const hav_lat = _mm256_mul_pd(
+        dlat2, avx2_poly(dlat2, 1.0 / 4.0, 1.0 / 48.0, 1.0 / 1440.0));
+    auto const hav_lng = _mm256_mul_pd(
+        dlng2, avx2_poly(dlng2, 1.0 / 4.0, 1.0 / 48.0, 1.0 / 1440.0));
+    auto const cos_lat2 = _mm256_sub_pd(_mm256_mul_pd(cos_lat1, cos_dlat),
+                                        _mm256_mul_pd(sin_lat1, sin_dlat));
+    auto const a = _mm256_add_pd(
+        hav_lat, _mm256_mul_pd(_mm256_mul_pd(cos_lat1, cos_lat2), hav_lng));
+
+    auto const in_range = _mm256_movemask_pd(
+        _mm256_and_pd(_mm256_cmp_pd(avx2_abs(dlat), max_angle, _CMP_LE_OQ),
+                      _mm256_cmp_pd(avx2_abs(dlng), max_angle, _CMP_LE_OQ)));
+    auto const inside = _mm256_movemask_pd(_mm256_cmp_pd(a, lo, _CMP_LT_OQ));
+    auto const outside = _mm256_movemask_pd(_mm256_cmp_pd(a, hi, _CMP_GT_OQ));
+
+    for (auto j = 0U; j != 4U; ++j) {
+      auto const bit = 1 << j;
+      out[i + j] = (in_range & bit) == 0 ? distance_check::kExact
+                   : (inside & bit) != 0 ? distance_check::kInside
+                   : (outside & bit) != 0 ? distance_check::kOutside
+                                          : distance_check::kExact;
+    }
+  }
+  return i;
+}
+
+#elif defined(__aarch64__)
+
+bool has_simd() { return true; }
+
+std::size_t classify_batch(params const& p,
+                           double const* lat,
+                           double const* lng,
+                           std::size_t const n,
+                           distance_check* out) {
+  auto const c = [](double const x) { return vdupq_n_f64(x); };
+  auto const poly = [&](float64x2_t const x2, double const c0, double const c1,
+                        double const c2) {
+    return vsubq_f64(c(c0), vmulq_f64(x2, vsubq_f64(c(c1), vmulq_f64(
+                                                               x2, c(c2)))));
+  };
+
+  auto i = std::size_t{0U};
+  for (; i + 2U <= n; i += 2U) {
+    auto const dlat =
+        vmulq_f64(vsubq_f64(vld1q_f64(lat + i), c(p.lat_)), c(kToRad));
+    auto const dlng =
+        vmulq_f64(vsubq_f64(vld1q_f64(lng + i), c(p.lng_)), c(kToRad));
+    auto const dlat2 = vmulq_f64(dlat, dlat);
+    auto const dlng2 = vmulq_f64(dlng, dlng);
+
+    auto const cos_dlat = poly(dlat2, 1.0, 1.0 / 2.0, 1.0 / 24.0);
+    auto const sin_dlat =
+        vmulq_f64(dlat, poly(dlat2, 1.0, 1.0 / 6.0, 1.0 / 120.0));
+    auto const hav_lat =
+        vmulq_f64(dlat2, poly(dlat2, 1.0 / 4.0, 1.0 / 48.0, 1.0 / 1440.0));
+    auto const hav_lng =
+        vmulq_f64(dlng2, poly(dlng2, 1.0 / 4.0, 1.0 / 48.0, 1.0 / 1440.0));
+    auto const cos_lat2 = vsubq_f64(vmulq_f64(c(p.cos_lat_), cos_dlat),
+                                    vmulq_f64(c(p.sin_lat_), sin_dlat));
+    auto const a = vaddq_f64(
+        hav_lat, vmulq_f64(vmulq_f64(c(p.cos_lat_), cos_lat2), hav_lng));
+
+    auto const in_range = vandq_u64(vcaleq_f64(dlat, c(kMaxAngle)),
+                                    vcaleq_f64(dlng, c(kMaxAngle)));
+    auto const inside = vcltq_f64(a, c(p.lo_));
+    auto const outside = vcgtq_f64(a, c(p.hi_));
+
+    auto const classify_lane = [&](std::uint64_t const r, std::uint64_t const x,
+                                   std::uint64_t const y) {
+      return r == 0U   ? distance_check::kExact
+             : x != 0U ? distance_check::kInside
+             : y != 0U ? distance_check::kOutside
+                       : distance_check::kExact;
+    };
+    out[i] = classify_lane(vgetq_lane_u64(in_range, 0),
+                           vgetq_lane_u64(inside, 0),
+                           vgetq_lane_u64(outside, 0));
+    out[i + 1U] = classify_lane(vgetq_lane_u64(in_range, 1),
+                                vgetq_lane_u64(inside, 1),
+                                vgetq_lane_u64(outside, 1));
+  }
+  return i;
+}
+
+#else
+
+bool has_simd() { return false; }
+
+std::size_t classify_batch(params const&,
+                           double const*,
+                           double const*,
+                           std::size_t,
+                           distance_check*) {
+  return 0U;
+}
+
+#endif
+
+}  // namespace
+
+bool has_simd_distance_filter() { return has_simd(); }
+
+void classify_distances(geo::latlng const& pos,
+                        double const radius,
+                        double const* lat,
+                        double const* lng,
+                        std::size_t const n,
+                        distance_check* out,
+                        bool const use_simd) {
+  if (!(radius <= 2.0 * geo::kEarthRadiusMeters * kMaxAngle)) {
+    std::fill(out, out + n, distance_check::kExact);
+    return;
+  }
+
+  auto const p = params{pos, radius};
+  auto i = use_simd && has_simd() ? classify_batch(p, lat, lng, n, out)
+                                  : std::size_t{0U};
+  for (; i < n; ++i) {
+    out[i] = classify(p, lat[i], lng[i]);
+  }
+}
+
+}  // namespace transfers
\ No newline at end of file
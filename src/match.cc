@@ -1,17 +1,82 @@
 #include "transfers/match.h"
 
+#include <algorithm>
+#include <optional>
+#include <ostream>
+
 #include "utl/enumerate.h"
+#include "utl/verify.h"
+
+#include "fmt/core.h"
 
 #include "nigiri/timetable.h"
 
+#include "transfers/distance_filter.h"
 #include "transfers/for_each_number.h"
 #include "transfers/rtree_index.h"
+#include "transfers/serialization.h"
 #include "transfers/types.h"
 
 namespace n = nigiri;
 
 namespace transfers {
 
+namespace {
+
+constexpr auto const kMatchRadius = 500.0;
+constexpr auto const kNumberMatchBonus = 200.0;
+
+template <typename T>
+cista::hash_t hash_bytes(T const& x, cista::hash_t const h) {
+  return cista::hash(
+      std::string_view{reinterpret_cast<char const*>(&x), sizeof(x)}, h);
+}
+
+cista::hash_t platform_fingerprint(database const& db,
+                                   platform_idx_t const p) {
+  auto const& x = db.platforms_[p];
+  auto h = hash_bytes(x.pos_.lat(), cista::BASE_HASH);
+  h = hash_bytes(x.pos_.lon(), h);
+  h = hash_bytes(x.id_, h);
+  h = hash_bytes(x.level_, h);
+  h = hash_bytes(x.type_, h);
+  for (auto const s : db.platform_names_[p]) {
+    h = cista::hash(s.view(), h);
+  }
+  return h;
+}
+
+vector_map<n::location_idx_t, cista::hash_t> location_fingerprints(
+    n::timetable const& tt) {
+  auto fingerprints = vector_map<n::location_idx_t, cista::hash_t>{};
+  fingerprints.resize(tt.n_locations());
+  for (auto l = n::location_idx_t{0U}; l != tt.n_locations(); ++l) {
+    fingerprints[l] = location_fingerprint(tt, l);
+  }
+  return fingerprints;
+}
+
+// Fingerprints of all platforms in index order. The hash also covers which
+// platforms are reachable through osm_to_platform_ (= can be matched).
+struct platform_fingerprints {
+  explicit platform_fingerprints(database const& db) {
+    auto active = std::vector<std::uint8_t>(db.platforms_.size());
+    for (auto const& [pos, p] : db.osm_to_platform_) {
+      active[to_idx(p)] = 1U;
+    }
+
+    fingerprints_.resize(db.platforms_.size());
+    for (auto p = platform_idx_t{0U}; p != db.platforms_.size(); ++p) {
+      fingerprints_[p] = platform_fingerprint(db, p);
+      hash_ = hash_bytes(fingerprints_[p], hash_);
+      hash_ = hash_bytes(active[to_idx(p)], hash_);
+    }
+  }
+
+  vector_map<platform_idx_t, cista::hash_t> fingerprints_;
+  cista::hash_t hash_{cista::BASE_HASH};
+};
+
 bool has_number_match(std::string_view a, std::string_view b) {
   auto match = false;
   for_each_number(a, [&](unsigned const x) {
@@ -26,22 +91,223 @@ bool has_number_match(Collection&& a, std::string_view b) {
                      [&](auto&& x) { return has_number_match(x.view(), b); });
 }
 
+struct matcher {
+  explicit matcher(database const& db) : db_{db} {
+    for (auto const& [pos, platform_idx] : db_.osm_to_platform_) {
+      rtree_.add(platform_idx, {pos.lat(), pos.lon()});
+    }
+  }
+
+  location_match match(n::timetable const& tt, n::location_idx_t const l) {
+    auto const pos = tt.locations_.coordinates_[l];
+
+    rtree_.search(pos, kMatchRadius, results_, candidates_);
+
+    number_matches_.resize(db_.platforms_.size());
+    for (auto r : results_) {
+      number_matches_[to_idx(r)] = has_number_match(
+          db_.platform_names_[r], tt.locations_.names_[l].view());
+    }
+
+    auto const score = [&](platform_idx_t const x) {
+      return geo::distance(to_geo(db_.platforms_[x].pos_), pos) -
+             (number_matches_[to_idx(x)] ? kNumberMatchBonus : 0.0);
+    };
+    utl::sort(results_, [&](platform_idx_t const a, platform_idx_t const b) {
+      return score(a) < score(b);
+    });
+
+    if (results_.empty()) {
+      return {};
+    }
+
+    auto const best = results_.front();
+    auto const& p = db_.platforms_[best];
+    return {.platform_ = best,
+            .score_ = static_cast<float>(score(best)),
+            .distance_ = static_cast<float>(geo::distance(to_geo(p.pos_), pos)),
+            .osm_id_ = p.id_,
+            .osm_type_ = static_cast<std::uint8_t>(p.type_)};
+  }
+
+  database const& db_;
+  rtree_index<platform_idx_t> rtree_;
+  std::vector<bool> number_matches_;
+  std::basic_string<platform_idx_t> results_;
+  distance_filter<platform_idx_t> candidates_;
+};
+
+// Header + everything rematch() needs to diff against a later version.
+match_result make_result(
+    n::timetable const& tt,
+    database const& db,
+    vector_map<n::location_idx_t, location_match>&& locations,
+    vector_map<n::location_idx_t, cista::hash_t>&& location_fps,
+    platform_fingerprints const& platform_fps,
+    std::uint32_t const n_matched) {
+  auto r = match_result{};
+  r.n_matched_ = n_matched;
+
+  auto& m = r.matches_;
+  m.n_locations_ = static_cast<std::uint32_t>(tt.n_locations());
+  m.locations_hash_ = locations_hash(location_fps);
+  m.platforms_hash_ = platform_fps.hash_;
+  m.locations_ = std::move(locations);
+
+  auto& s = r.state_;
+  for (auto const& [pos, p] : db.osm_to_platform_) {
+    s.platforms_.push_back(platform_fps.fingerprints_[p]);
+  }
+  utl::sort(s.platforms_);
+  s.platform_fingerprints_.resize(tt.n_locations());
+  for (auto l = n::location_idx_t{0U}; l != tt.n_locations(); ++l) {
+    s.ids_.emplace_back(tt.locations_.ids_[l].view());
+    s.platform_fingerprints_[l] =
+        m.locations_[l].platform_ == platform_idx_t::invalid()
+            ? cista::BASE_HASH
+            : platform_fps.fingerprints_[m.locations_[l].platform_];
+  }
+  s.fingerprints_ = std::move(location_fps);
+
+  return r;
+}
+
+}  // namespace
+
+cista::hash_t platforms_hash(database const& db) {
+  return platform_fingerprints{db}.hash_;
+}
+
+bool fits(matches const& m, n::timetable const& tt, database const& db) {
+  return m.fits(tt) && m.platforms_hash_ == platforms_hash(db);
+}
+
+void rematch_state::write(std::filesystem::path const& p) const {
+  transfers::write(p, *this);
+}
+
+cista::wrapped<rematch_state> rematch_state::read(cista::memory_holder&& mem) {
+  return transfers::read<rematch_state>(std::move(mem));
+}
+
 // Assumption: database is already filled with non-redundant OSM entries
-void match(n::timetable const& tt, database& db) {
-  std::cout << "{\n"
-            << "  \"features\": [\n";
+match_result match(n::timetable const& tt, database const& db) {
+  auto locations = vector_map<n::location_idx_t, location_match>{};
+  locations.resize(tt.n_locations());
+
+  auto mt = matcher{db};
+  for (auto l = n::location_idx_t{0U}; l != tt.n_locations(); ++l) {
+    locations[l] = mt.match(tt, l);
+  }
+
+  return make_result(tt, db, std::move(locations), location_fingerprints(tt),
+                     platform_fingerprints{db},
+                     static_cast<std::uint32_t>(tt.n_locations()));
+}
+
+match_result rematch(n::timetable const& tt,
+                     database const& db,
+                     matches const& prev,
+                     rematch_state const& prev_state) {
+  utl::verify(prev_state.ids_.size() == prev.locations_.size(),
+              "rematch: state does not belong to matches [state={}, "
+              "matches={}]",
+              prev_state.ids_.size(), prev.locations_.size());
+
+  auto location_fps = location_fingerprints(tt);
+  auto const platform_fps = platform_fingerprints{db};
+
+  // Same platform database: previous platform indices are still valid.
+  // Otherwise, map platforms by fingerprint and collect platforms that were
+  // not present in the previous version. Stops near them have to be
+  // re-matched.
+  auto const same_platforms = platform_fps.hash_ == prev.platforms_hash_;
+  auto platforms = hash_map<cista::hash_t, platform_idx_t>{};
+  auto added_rtree = rtree_index<platform_idx_t>{};
+  auto n_added = 0U;
+  if (!same_platforms) {
+    for (auto const& [pos, p] : db.osm_to_platform_) {
+      auto const fp = platform_fps.fingerprints_[p];
+      platforms.emplace(fp, p);
+      if (!std::binary_search(begin(prev_state.platforms_),
+                              end(prev_state.platforms_), fp)) {
+        added_rtree.add(p, {pos.lat(), pos.lon()});
+        ++n_added;
+      }
+    }
+  }
+
+  auto prev_locations = hash_map<std::string_view, n::location_idx_t>{};
+  for (auto l = n::location_idx_t{0U}; l != prev_state.ids_.size(); ++l) {
+    prev_locations.emplace(prev_state.ids_[l].view(), l);
+  }
+
+  auto added = std::basic_string<platform_idx_t>{};
+  auto added_candidates = distance_filter<platform_idx_t>{};
+  auto const reuse =
+      [&](n::location_idx_t const l) -> std::optional<location_match> {
+    auto const it = prev_locations.find(tt.locations_.ids_[l].view());
+    if (it == end(prev_locations) ||
+        prev_state.fingerprints_[it->second] != location_fps[l]) {
+      return std::nullopt;
+    }
+
+    if (n_added != 0U) {
+      added_rtree.search(tt.locations_.coordinates_[l], kMatchRadius, added,
+                         added_candidates);
+      if (!added.empty()) {
+        return std::nullopt;
+      }
+    }
 
-  auto platform_rtree = rtree_index<platform_idx_t>{};
-  for (auto const& [pos, platform_idx] : db.osm_to_platform_) {
-    platform_rtree.add(platform_idx, {pos.lat(), pos.lon()});
+    auto x = prev.locations_[it->second];
+    if (x.platform_ == platform_idx_t::invalid() || same_platforms) {
+      return x;
+    }
+
+    auto const p =
+        platforms.find(prev_state.platform_fingerprints_[it->second]);
+    if (p == end(platforms)) {
+      return std::nullopt;
+    }
+    x.platform_ = p->second;
+    return x;
+  };
+
+  auto locations = vector_map<n::location_idx_t, location_match>{};
+  locations.resize(tt.n_locations());
+
+  auto n_matched = 0U;
+  auto mt = std::optional<matcher>{};
+  for (auto l = n::location_idx_t{0U}; l != tt.n_locations(); ++l) {
+    if (auto const x = reuse(l); x.has_value()) {
+      locations[l] = *x;
+    } else {
+      if (!mt.has_value()) {
+        mt.emplace(db);
+      }
+      locations[l] = mt->match(tt, l);
+      ++n_matched;
+    }
   }
 
+  return make_result(tt, db, std::move(locations), std::move(location_fps),
+                     platform_fps, n_matched);
+}
+
+void write_geojson(std::ostream& out,
+                   n::timetable const& tt,
+                   database const& db,
+                   matches const& m) {
+  out << "{\n"
+      << "  \"features\": [\n";
+
   for (auto const [idx, x] : utl::enumerate(db.platforms_)) {
     std::string name;
     for (auto const s : db.platform_names_[platform_idx_t{idx}]) {
       name += std::string{s.view()} + ", ";
     }
-    std::cout << fmt::format(
+    out << fmt::format(
         R"(    {{
       "type": "Feature",
       "properties": {{
@@ -61,7 +327,7 @@ void match(n::timetable const& tt, database& db) {
   for (auto l = n::location_idx_t{0U}; l != tt.n_locations(); ++l) {
     auto const pos = tt.locations_.coordinates_[l];
 
-    std::cout << fmt::format(R"(    {{
+    out << fmt::format(R"(    {{
       "type": "Feature",
       "properties": {{
         "name": "{}",
@@ -73,39 +339,20 @@ void match(n::timetable const& tt, database& db) {
         "type": "Point"
       }}
     }},)",
-                             tt.locations_.names_[l].view(),
-                             tt.locations_.ids_[l].view(), pos.lng_, pos.lat_);
+                       tt.locations_.names_[l].view(),
+                       tt.locations_.ids_[l].view(), pos.lng_, pos.lat_);
   }
 
-  //  std::cout << "N locations = " << tt.n_locations() << "\n";
-  auto number_matches = std::vector<bool>{};
-  auto results = std::basic_string<platform_idx_t>{};
   for (auto l = n::location_idx_t{0U}; l != tt.n_locations(); ++l) {
-    auto const pos = tt.locations_.coordinates_[l];
-
-    platform_rtree.search(pos, 500, results);
-
-    number_matches.resize(db.platforms_.size());
-    for (auto r : results) {
-      number_matches[to_idx(r)] = has_number_match(
-          db.platform_names_[r], tt.locations_.names_[l].view());
-    }
-
-    constexpr auto const kNumberMatchBonus = 200.0;
-    utl::sort(results, [&](platform_idx_t const a, platform_idx_t const b) {
-      return geo::distance(to_geo(db.platforms_[a].pos_), pos) -
-                 (number_matches[to_idx(a)] ? kNumberMatchBonus : 0.0) <
-             geo::distance(to_geo(db.platforms_[b].pos_), pos) -
-                 (number_matches[to_idx(b)] ? kNumberMatchBonus : 0.0);
-    });
-
-    if (results.empty()) {
+    if (m.locations_[l].platform_ == platform_idx_t::invalid()) {
       continue;
     }
 
-    auto const best = to_geo(db.platforms_[results.front()].pos_);
+    auto const pos = tt.locations_.coordinates_[l];
+    auto const& best_platform = db.platforms_[m.locations_[l].platform_];
+    auto const best = to_geo(best_platform.pos_);
 
-    std::cout << fmt::format(R"(    {{
+    out << fmt::format(R"(    {{
       "type": "Feature",
       "properties": {{
         "name": "{}/{} VS {}"
@@ -118,38 +365,16 @@ void match(n::timetable const& tt, database& db) {
         "type": "LineString"
       }}
     }},)",
-                             db.platforms_[results.front()].type_ ==
-                                     ppr::routing::osm_namespace::NODE
-                                 ? "node"
-                                 : "way",
-                             db.platforms_[results.front()].id_,
-                             tt.locations_.names_[l].view(), pos.lng_, pos.lat_,
-                             best.lng_, best.lat_);
-
-    //    std::cout << "MATCHES: size=" << results.size()
-    //              << ", tt_name=" << tt.locations_.names_[l].view() <<
-    //              "\n";
-    //    for (auto const& x : results) {
-    //      for (auto const& y : db.platform_names_[x]) {
-    //        std::cout << "  " << y.view() << " | ";
-    //      }
-    //      std::cout << "\n";
-    //    }
-
-    //    if (results.empty()) {
-    //      // No match found.
-    //    }
-    //
-    //    auto const it =
-    //        db.tt_to_platform_.find(to_ppr(tt.locations_.coordinates_[l]));
-    //    if (it == end(db.tt_to_platform_)) {
-    //      db.tt_to_platform_.emplace();
-    //    }
+                       best_platform.type_ == ppr::routing::osm_namespace::NODE
+                           ? "node"
+                           : "way",
+                       best_platform.id_, tt.locations_.names_[l].view(),
+                       pos.lng_, pos.lat_, best.lng_, best.lat_);
   }
 
-  std::cout << "  ],\n"
-            << "  \"type\": \"FeatureCollection\"\n"
-            << "}\n";
+  out << "  ],\n"
+      << "  \"type\": \"FeatureCollection\"\n"
+      << "}\n";
 }
 
-}  // namespace transfers
+}  // namespace transfers
\ No newline at end of file
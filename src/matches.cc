@@ -0,0 +1,59 @@
+#include "transfers/matches.h"
+
+#include "nigiri/timetable.h"
+
+#include "transfers/serialization.h"
+
+namespace n = nigiri;
+
+namespace transfers {
+
+namespace {
+
+template <typename T>
+cista::hash_t hash_bytes(T const& x, cista::hash_t const h) {
+  return cista::hash(
+      std::string_view{reinterpret_cast<char const*>(&x), sizeof(x)}, h);
+}
+
+}  // namespace
+
+cista::hash_t location_fingerprint(n::timetable const& tt,
+                                   n::location_idx_t const l) {
+  auto h = cista::hash(tt.locations_.ids_[l].view());
+  h = cista::hash(tt.locations_.names_[l].view(), h);
+  return hash_bytes(tt.locations_.coordinates_[l], h);
+}
+
+cista::hash_t locations_hash(
+    cista::offset::vector_map<n::location_idx_t, cista::hash_t> const&
+        fingerprints) {
+  auto h = cista::BASE_HASH;
+  for (auto const fp : fingerprints) {
+    h = hash_bytes(fp, h);
+  }
+  return h;
+}
+
+cista::hash_t locations_hash(n::timetable const& tt) {
+  auto h = cista::BASE_HASH;
+  for (auto l = n::location_idx_t{0U}; l != tt.n_locations(); ++l) {
+    h = hash_bytes(location_fingerprint(tt, l), h);
+  }
+  return h;
+}
+
+bool matches::fits(n::timetable const& tt) const {
+  return version_ == kVersion && n_locations_ == tt.n_locations() &&
+         locations_hash_ == locations_hash(tt);
+}
+
+void matches::write(std::filesystem::path const& p) const {
+  transfers::write(p, *this);
+}
+
+cista::wrapped<matches> matches::read(cista::memory_holder&& mem) {
+  return transfers::read<matches>(std::move(mem));
+}
+
+}  // namespace transfers
\ No newline at end of file
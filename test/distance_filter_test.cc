@@ -0,0 +1,190 @@
+#include <algorithm>
+#include <random>
+
+#include "gtest/gtest.h"
+
+#include "utl/enumerate.h"
+
+#include "transfers/distance_filter.h"
+#include "transfers/rtree_index.h"
+#include "transfers/types.h"
+
+using transfers::distance_check;
+using transfers::platform_idx_t;
+
+namespace {
+
+std::vector<std::size_t> brute_force(
+    std::vector<geo::latlng> const& points,
+    geo::latlng const& pos,
+    double const radius) {
+  auto results = std::vector<std::size_t>{};
+  for (auto const [i, x] : utl::enumerate(points)) {
+    if (!(geo::distance(pos, x) > radius)) {
+      results.push_back(i);
+    }
+  }
+  return results;
+}
+
+std::vector<std::size_t> sorted(
+    std::basic_string<platform_idx_t> const& results) {
+  auto v = std::vector<std::size_t>{};
+  for (auto const x : results) {
+    v.push_back(to_idx(x));
+  }
+  std::sort(begin(v), end(v));
+  return v;
+}
+
+// Every decision taken without geo::distance has to agree with it.
+// Returns the number of candidates left to geo::distance.
+std::size_t check_classification(std::vector<geo::latlng> const& points,
+                                 geo::latlng const& pos,
+                                 double const radius) {
+  auto lat = std::vector<double>{};
+  auto lng = std::vector<double>{};
+  for (auto const& x : points) {
+    lat.push_back(x.lat_);
+    lng.push_back(x.lng_);
+  }
+
+  auto n_exact = std::size_t{0U};
+  auto checks = std::vector<distance_check>(points.size());
+  for (auto const use_simd : {false, true}) {
+    if (use_simd && !transfers::has_simd_distance_filter()) {
+      continue;
+    }
+    transfers::classify_distances(pos, radius, lat.data(), lng.data(),
+                                  points.size(), checks.data(), use_simd);
+    for (auto const [i, c] : utl::enumerate(checks)) {
+      auto const outside = geo::distance(pos, points[i]) > radius;
+      if (c == distance_check::kInside) {
+        EXPECT_FALSE(outside) << "simd=" << use_simd << ", i=" << i;
+      } else if (c == distance_check::kOutside) {
+        EXPECT_TRUE(outside) << "simd=" << use_simd << ", i=" << i;
+      } else {
+        ++n_exact;
+      }
+    }
+  }
+  return n_exact;
+}
+
+void check(geo::latlng const& center, double const radius) {
+  auto rng = std::mt19937{42U};
+  auto offset = std::uniform_real_distribution<double>{-0.02, 0.02};
+
+  auto points = std::vector<geo::latlng>{};
+  auto rtree = transfers::rtree_index<platform_idx_t>{};
+  for (auto i = 0U; i != 2000U; ++i) {
+    auto const x = geo::latlng{center.lat_ + offset(rng) / 2.0,
+                               center.lng_ + offset(rng)};
+    rtree.add(platform_idx_t{points.size()}, x);
+    points.push_back(x);
+  }
+
+  // Duplicates of search positions (distance 0) and points ~30cm away.
+  for (auto i = 0U; i != 100U; ++i) {
+    auto const p = points[i / 2U];
+    auto const x = i % 2U == 0U ? p : geo::latlng{p.lat_ + 3E-6, p.lng_};
+    rtree.add(platform_idx_t{points.size()}, x);
+    points.push_back(x);
+  }
+
+  auto results = std::basic_string<platform_idx_t>{};
+  auto candidates = transfers::distance_filter<platform_idx_t>{};
+  for (auto i = 0U; i != 50U; ++i) {
+    // Radius = distance to another point: it lies exactly on the boundary.
+    auto const& pos = points[i];
+    auto const& nearby = points[2001U + 2U * i];
+    for (auto const r : {radius, geo::distance(pos, points[i + 1U]), 0.0, 0.5,
+                         geo::distance(pos, nearby)}) {
+      rtree.search(pos, r, results, candidates);
+      EXPECT_EQ(brute_force(points, pos, r), sorted(results));
+      check_classification(points, pos, r);
+    }
+  }
+}
+
+}  // namespace
+
+TEST(transfers, distance_filter) {
+  check({49.872, 8.631}, 500.0);  // Darmstadt
+  check({50.107, 8.663}, 150.0);  // Frankfurt
+  check({-33.868, 151.209}, 500.0);  // Sydney
+  check({78.223, 15.646}, 800.0);  // Longyearbyen
+}
+
+TEST(transfers, distance_filter_fallback) {
+  // Candidates outside of the small angle domain of the approximation:
+  // close to the pole, across the antimeridian, and far away.
+  auto const check_fallback = [](geo::latlng const& pos,
+                                 std::vector<geo::latlng> const& points,
+                                 double const radius) {
+    auto filter = transfers::distance_filter<platform_idx_t>{};
+    for (auto const [i, x] : utl::enumerate(points)) {
+      filter.add(platform_idx_t{i}, x);
+    }
+    auto results = std::basic_string<platform_idx_t>{};
+    filter.filter(pos, radius, results);
+    EXPECT_EQ(brute_force(points, pos, radius), sorted(results));
+    EXPECT_NE(0U, check_classification(points, pos, radius));
+  };
+
+  auto const pole = geo::latlng{89.9995, 10.0};
+  auto pole_points = std::vector<geo::latlng>{};
+  for (auto lng = -170.0; lng <= 180.0; lng += 15.0) {
+    pole_points.push_back({89.9995, lng});
+    pole_points.push_back({89.999, lng});
+  }
+  check_fallback(pole, pole_points, 100.0);
+
+  check_fallback({0.0, 179.9999},
+                 {{0.0, -179.9999},
+                  {0.0001, -179.9998},
+                  {0.0, 179.9998},
+                  {0.0, 179.0},
+                  {1.0, 179.9999}},
+                 50.0);
+
+  check_fallback({49.872, 8.631},
+                 {{49.872, 8.631},
+                  {49.873, 8.632},
+                  {50.872, 8.631},
+                  {49.872, 9.631},
+                  {-49.872, 8.631}},
+                 500.0);
+}
+
+TEST(transfers, distance_filter_simd) {
+  if (!transfers::has_simd_distance_filter()) {
+    GTEST_SKIP() << "no AVX2 / NEON";
+  }
+
+  // Vectorized and scalar kernel compute the same expressions. They may
+  // only differ by leaving a candidate to geo::distance (FMA contraction).
+  auto rng = std::mt19937{7U};
+  auto offset = std::uniform_real_distribution<double>{-0.01, 0.01};
+  auto const pos = geo::latlng{50.107, 8.663};
+  auto lat = std::vector<double>{};
+  auto lng = std::vector<double>{};
+  for (auto i = 0U; i != 1001U; ++i) {
+    lat.push_back(pos.lat_ + offset(rng));
+    lng.push_back(pos.lng_ + offset(rng));
+  }
+
+  auto scalar = std::vector<distance_check>(lat.size());
+  auto simd = std::vector<distance_check>(lat.size());
+  for (auto const r : {0.0, 0.5, 150.0, 500.0, 1000.0}) {
+    transfers::classify_distances(pos, r, lat.data(), lng.data(), lat.size(),
+                                  scalar.data(), false);
+    transfers::classify_distances(pos, r, lat.data(), lng.data(), lat.size(),
+                                  simd.data(), true);
+    for (auto i = 0U; i != lat.size(); ++i) {
+      EXPECT_TRUE(scalar[i] == simd[i] || scalar[i] == distance_check::kExact ||
+                  simd[i] == distance_check::kExact)
+          << "r=" << r << ", i=" << i;
+    }
+  }
+}
\ No newline at end of file
@@ -1,5 +1,12 @@
+#include <algorithm>
+#include <filesystem>
+#include <random>
+#include <sstream>
+
 #include "gtest/gtest.h"
 
+#include "cista/mmap.h"
+
 #include "utl/zip.h"
 
 #include "fmt/core.h"
@@ -72,14 +79,68 @@ constexpr auto const stations = R"(
 
 )";
 
-TEST(transfers, extract) {
+void expect_eq(transfers::matches const& a, transfers::matches const& b) {
+  ASSERT_EQ(a.locations_.size(), b.locations_.size());
+  for (auto const [x, y] : utl::zip(a.locations_, b.locations_)) {
+    EXPECT_EQ(x.platform_, y.platform_);
+    EXPECT_EQ(x.score_, y.score_);
+    EXPECT_EQ(x.distance_, y.distance_);
+    EXPECT_EQ(x.osm_id_, y.osm_id_);
+    EXPECT_EQ(x.osm_type_, y.osm_type_);
+  }
+}
+
+nigiri::timetable load(std::string_view stops) {
   auto tt = nigiri::timetable{};
   tt.date_range_ = {2023_y / December / 20, 2023_y / December / 21};
   nigiri::loader::gtfs::load_timetable(
-      {}, nigiri::source_idx_t{0}, nigiri::loader::mem_dir::read(stations), tt);
+      {}, nigiri::source_idx_t{0}, nigiri::loader::mem_dir::read(stops), tt);
+  return tt;
+}
 
+TEST(transfers, extract) {
+  auto const tt = load(stations);
   auto db = transfers::extract("test/da_hbf.osm.pbf", "/tmp");
-  transfers::match(tt, db);
+  auto const r = transfers::match(tt, db);
+  auto const& m = r.matches_;
+  ASSERT_EQ(tt.n_locations(), m.locations_.size());
+  EXPECT_TRUE(m.fits(tt));
+  EXPECT_TRUE(transfers::fits(m, tt, db));
+
+  // Stop names influence matching (number bonus) -> renamed stops don't fit.
+  auto renamed = std::string{stations};
+  renamed.replace(renamed.find("Darmstadt Hauptbahnhof"),
+                  std::string_view{"Darmstadt Hauptbahnhof"}.size(),
+                  "Darmstadt Hbf 1");
+  EXPECT_FALSE(m.fits(load(renamed)));
+
+  auto const tmp = std::filesystem::temp_directory_path() /
+                   fmt::format("transfers-extract-test-{}",
+                               std::random_device{}());
+  auto const matches_path = fmt::format("{}-matches.bin", tmp.string());
+  auto const state_path = fmt::format("{}-state.bin", tmp.string());
+  auto const open = [](std::string const& path) {
+    return cista::memory_holder{cista::buf<cista::mmap>{
+        cista::mmap{path.c_str(), cista::mmap::protection::READ}}};
+  };
+  {
+    m.write(matches_path);
+    r.state_.write(state_path);
+    auto const loaded = transfers::matches::read(open(matches_path));
+    auto const state = transfers::rematch_state::read(open(state_path));
+    EXPECT_TRUE(transfers::fits(*loaded, tt, db));
+    expect_eq(m, *loaded);
+
+    auto const rematched = transfers::rematch(tt, db, *loaded, *state);
+    expect_eq(m, rematched.matches_);
+    EXPECT_EQ(0U, rematched.n_matched_);
+  }
+  std::filesystem::remove(matches_path);
+  std::filesystem::remove(state_path);
+
+  auto geojson = std::stringstream{};
+  transfers::write_geojson(geojson, tt, db, m);
+  EXPECT_NE(std::string::npos, geojson.str().find("FeatureCollection"));
 
   //  for (auto const& [x, names] : utl::zip(db.platforms_, db.platform_names_))
   //  {
@@ -91,4 +152,122 @@ TEST(transfers, extract) {
   //    }
   //    fmt::print("\n");
   //  }
+}
+
+nigiri::location_idx_t find_location(nigiri::timetable const& tt,
+                                     std::string_view id) {
+  for (auto l = nigiri::location_idx_t{0U}; l != tt.n_locations(); ++l) {
+    if (tt.locations_.ids_[l].view() == id) {
+      return l;
+    }
+  }
+  return nigiri::location_idx_t::invalid();
+}
+
+// Number of locations within the match radius of `pos`.
+unsigned n_near(nigiri::timetable const& tt, geo::latlng const& pos) {
+  auto n = 0U;
+  for (auto l = nigiri::location_idx_t{0U}; l != tt.n_locations(); ++l) {
+    if (geo::distance(tt.locations_.coordinates_[l], pos) <= 500.0) {
+      ++n;
+    }
+  }
+  return n;
+}
+
+// Adds or replaces (same position) a platform, like extract() does.
+transfers::platform_idx_t add_platform(
+    transfers::database& db,
+    transfers::platform const& p,
+    std::initializer_list<std::string_view> names) {
+  auto strings = transfers::vecvec<std::uint32_t, char>{};
+  for (auto const name : names) {
+    strings.emplace_back(name);
+  }
+  auto const idx = transfers::platform_idx_t{db.platforms_.size()};
+  db.platforms_.emplace_back(p);
+  db.platform_names_.emplace_back(strings);
+  db.osm_to_platform_.erase(p.pos_);
+  db.osm_to_platform_.emplace(p.pos_, idx);
+  return idx;
+}
+
+TEST(transfers, rematch) {
+  auto const tt = load(stations);
+  auto db = transfers::extract("test/da_hbf.osm.pbf", "/tmp");
+  auto const m = transfers::match(tt, db);
+  EXPECT_EQ(tt.n_locations(), m.n_matched_);
+
+  // Unchanged timetable: everything is reused.
+  auto const unchanged = transfers::rematch(tt, db, m.matches_, m.state_);
+  expect_eq(m.matches_, unchanged.matches_);
+  EXPECT_EQ(0U, unchanged.n_matched_);
+
+  // Moved, renamed, removed and added stops.
+  auto changed = std::string{stations};
+  auto const replace = [&](std::string_view from, std::string_view to) {
+    auto const pos = changed.find(from);
+    ASSERT_NE(pos, std::string::npos);
+    changed.replace(pos, from.size(), to);
+  };
+  replace(R"("Tram Platz 1","49.872397000000","8.631640000000")",
+          R"("Tram Platz 1","49.873037000000","8.629159000000")");
+  replace(R"("de:06411:4734:44:44","","Darmstadt Hauptbahnhof")",
+          R"("de:06411:4734:44:44","","Darmstadt Hauptbahnhof 8")");
+  replace(
+      R"("de:06411:4734:50:51","","Darmstadt Hauptbahnhof","Bus Platz 11","49.871957000000","8.631546000000",0,,0,"11 Ost","2")",
+      R"("de:06411:4734:99:99","","Darmstadt Hauptbahnhof","Bus Platz 9","49.872100000000","8.631500000000",0,,0,"9 Ost","2")");
+
+  auto const changed_tt = load(changed);
+  auto prev = transfers::rematch(changed_tt, db, m.matches_, m.state_);
+  EXPECT_TRUE(transfers::fits(prev.matches_, changed_tt, db));
+  expect_eq(transfers::match(changed_tt, db).matches_, prev.matches_);
+  EXPECT_EQ(3U, prev.n_matched_);
+
+  auto const check = [&](unsigned const expected_n_matched) {
+    EXPECT_FALSE(transfers::fits(prev.matches_, changed_tt, db));
+    auto rematched =
+        transfers::rematch(changed_tt, db, prev.matches_, prev.state_);
+    EXPECT_TRUE(transfers::fits(rematched.matches_, changed_tt, db));
+    expect_eq(transfers::match(changed_tt, db).matches_, rematched.matches_);
+    EXPECT_EQ(expected_n_matched, rematched.n_matched_);
+    prev = std::move(rematched);
+  };
+
+  // New platform at a stop with matching number -> becomes its best match.
+  // Every stop within the match radius has to be re-matched.
+  auto const bus_2 = find_location(changed_tt, "de:06411:4734:47:47");
+  ASSERT_NE(nigiri::location_idx_t::invalid(), bus_2);
+  auto const bus_2_pos = changed_tt.locations_.coordinates_[bus_2];
+  auto const added = add_platform(
+      db,
+      transfers::platform{.pos_ = transfers::to_ppr(bus_2_pos),
+                          .id_ = 1,
+                          .level_ = 0,
+                          .type_ = ppr::routing::osm_namespace::NODE},
+      {"2"});
+  check(n_near(changed_tt, bus_2_pos));
+  EXPECT_EQ(added, prev.matches_.locations_[bus_2].platform_);
+
+  // Best platform of a stop removed -> all stops matched to it.
+  auto const track_6 = find_location(changed_tt, "de:06411:4734:41:41");
+  ASSERT_NE(nigiri::location_idx_t::invalid(), track_6);
+  auto const removed = prev.matches_.locations_[track_6].platform_;
+  ASSERT_NE(transfers::platform_idx_t::invalid(), removed);
+  auto const& prev_locations = prev.matches_.locations_;
+  auto const n_matched_to_removed = static_cast<unsigned>(
+      std::count_if(begin(prev_locations), end(prev_locations),
+                    [&](auto&& x) { return x.platform_ == removed; }));
+  db.osm_to_platform_.erase(db.platforms_[removed].pos_);
+  check(n_matched_to_removed);
+
+  // Renamed platform (number bonus changes) = removed + added at the same
+  // position -> all stops within the match radius.
+  auto const track_12 = find_location(changed_tt, "de:06411:4734:43:43");
+  ASSERT_NE(nigiri::location_idx_t::invalid(), track_12);
+  auto const renamed = prev.matches_.locations_[track_12].platform_;
+  ASSERT_NE(transfers::platform_idx_t::invalid(), renamed);
+  auto const renamed_platform = db.platforms_[renamed];
+  add_platform(db, renamed_platform, {"Gleis 99"});
+  check(n_near(changed_tt, transfers::to_geo(renamed_platform.pos_)));
 }
\ No newline at end of file